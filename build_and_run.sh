@@ -8,3 +8,16 @@ cd ..
 #opt -load build/lib/StatsCount.so --stCounter --enable-new-pm=0 -disable-output main.ll
 clang -O0 -fno-inline -c -emit-llvm  -Xclang -disable-O0-optnone main.c -o main.bc
 opt -load build/lib/StatsCount.so -mem2reg -loop-rotate -scalar-evolution -stCounter --enable-new-pm=0 -disable-output main.bc
+# Compare loop features against another build of main.c (needs -g on both sides to match loops;
+# stDiff runs mem2reg and loop-rotate on both modules itself)
+#clang -O0 -g -fno-inline -c -emit-llvm -Xclang -disable-O0-optnone main.c -o main.bc
+#clang -O2 -g -fno-inline -c -emit-llvm main.c -o main.O2.bc
+#opt -load build/lib/StatsCount.so -stDiff -diff-base=main.O2.bc --enable-new-pm=0 -disable-output main.bc
+# Analyze a 10% sample of the functions and print scaled corpus estimates
+#opt -load build/lib/StatsCount.so -mem2reg -loop-rotate -scalar-evolution -stCounter -sample-rate=0.1 -sample-seed=1 --enable-new-pm=0 -disable-output main.bc
+# Reuse the analysis of structurally identical loop nests (same "Loop Fingerprint")
+#opt -load build/lib/StatsCount.so -mem2reg -loop-rotate -scalar-evolution -stCounter -dedup --enable-new-pm=0 -disable-output main.bc
+# Fold callee summaries into the loops that call them (walks the call graph bottom-up)
+#opt -load build/lib/StatsCount.so -mem2reg -loop-rotate -stInterproc -loop-weight=10 --enable-new-pm=0 -disable-output main.bc
+# Write the loop ID => source range / IR blocks index next to the output
+#opt -load build/lib/StatsCount.so -mem2reg -loop-rotate -scalar-evolution -stCounter -loop-index=main.loops.idx --enable-new-pm=0 -disable-output main.bc
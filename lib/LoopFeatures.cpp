@@ -0,0 +1,475 @@
+#include "LoopFeatures.h"
+
+#include "llvm/ADT/Triple.h"
+#include "llvm/Analysis/AssumptionCache.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/xxhash.h"
+
+#include <unordered_map>
+
+using namespace llvm;
+
+void visitBinOpInstr(Instruction *BinOpInstr, int (&localStats)[3]) {
+
+  for (int i = 0; i < BinOpInstr->getNumOperands(); ++i) {
+
+    Value *currentOperand = BinOpInstr->getOperand(i);
+
+    if (isa<BinaryOperator>(currentOperand)) {
+
+      Instruction *currentOperandAsInstr = cast<Instruction>(currentOperand);
+      visitBinOpInstr(currentOperandAsInstr, localStats);
+
+    } else {
+
+      if (isa<ConstantData>(currentOperand)) {
+
+        // Increment number of constants in the expression
+        localStats[1]++;
+      } else {
+
+        if (isa<PHINode>(currentOperand)) {
+
+          // Increment PHINodes count
+          localStats[0]++;
+        } else {
+
+          // Increment Parametric
+          localStats[2]++;
+        }
+      }
+    }
+  }
+}
+
+int arrayRefUsers(Instruction *I) {
+  GetElementPtrInst *GEP = dyn_cast<GetElementPtrInst>(I);
+  if (!GEP || !isa<ArrayType>(GEP->getSourceElementType()))
+    return 0;
+  return std::distance(GEP->user_begin(), GEP->user_end());
+}
+
+void classifyIndexExpr(Instruction *GEP, int step,
+                       int (&idxExpressionCounter)[4]) {
+
+  // Get the GEP index expression (operand)
+  Value *gepOperand = GEP->getOperand(GEP->getNumOperands() - 1);
+
+  // Only index expressions computed by an instruction are classified (it is
+  // noticed that this instruction is usually a sext instr which has only one
+  // operand)
+  Instruction *gepOperandI = dyn_cast<Instruction>(gepOperand);
+  if (!gepOperandI)
+    return;
+
+  for (int i = 0; i < gepOperandI->getNumOperands(); ++i) {
+    Value *gepOperandIOperand = gepOperandI->getOperand(i);
+
+    // If this operand is a Phi Node, most likely it is the induction variable
+    // of the loop (i or j, etc.)
+    if (isa<PHINode>(gepOperandIOperand)) {
+      idxExpressionCounter[0] += step;
+    } else if (isa<BinaryOperator>(gepOperandIOperand)) {
+      int localStats[] = {0, 0, 0};
+      visitBinOpInstr(cast<Instruction>(gepOperandIOperand), localStats);
+
+      if (localStats[0] > 1)
+        idxExpressionCounter[3] += step;
+      if (localStats[1] > 0)
+        idxExpressionCounter[1] += step;
+      if (localStats[2] > 0)
+        idxExpressionCounter[2] += step;
+    }
+  }
+}
+
+std::string loopLocation(Loop *L) {
+  DebugLoc DL = L->getStartLoc();
+  if (!DL)
+    return "";
+
+  DILocation *Loc = DL.get();
+  return (Loc->getFilename() + ":" + Twine(Loc->getLine()) + ":" +
+          Twine(Loc->getColumn()))
+      .str();
+}
+
+std::string loopId(Loop *L, const std::string &Path) {
+  std::string Id = L->getHeader()->getParent()->getName().str() + "|";
+  std::string Location = loopLocation(L);
+  if (Location.empty())
+    return Id + Path;
+
+  std::string Nesting = Location;
+  for (Loop *Parent = L->getParentLoop(); Parent;
+       Parent = Parent->getParentLoop()) {
+    std::string ParentLocation = loopLocation(Parent);
+    if (ParentLocation.empty())
+      return Id + Path;
+    Nesting = ParentLocation + ">" + Nesting;
+  }
+  return Id + Nesting;
+}
+
+std::string uniqueLoopId(Loop *L, const std::string &Path,
+                         std::unordered_map<std::string, unsigned> &Seen) {
+  std::string Id = loopId(L, Path);
+  unsigned Count = Seen[Id]++;
+  if (Count)
+    Id += "#" + std::to_string(Count + 1);
+  return Id;
+}
+
+std::string loopSourceRange(Loop *L) {
+  DebugLoc DL = L->getStartLoc();
+  if (!DL)
+    return "";
+
+  StringRef File = DL.get()->getFilename();
+  unsigned First = DL.getLine(), Last = DL.getLine();
+  for (BasicBlock *BB : L->getBlocks()) {
+    for (Instruction &I : *BB) {
+      DILocation *Loc = I.getDebugLoc().get();
+      // Skip compiler generated (line 0) and inlined code from other files
+      if (!Loc || Loc->getLine() == 0 || Loc->getFilename() != File)
+        continue;
+      First = std::min(First, Loc->getLine());
+      Last = std::max(Last, Loc->getLine());
+    }
+  }
+  return (File + ":" + Twine(First) + "-" + Twine(Last)).str();
+}
+
+std::string loopBlockNames(Loop *L) {
+  std::string Names;
+  for (BasicBlock *BB : L->getBlocks()) {
+    if (!Names.empty())
+      Names += ",";
+    Names += BB->hasName() ? BB->getName().str() : "-";
+  }
+  return Names;
+}
+
+// Type class used by the fingerprint
+static void printTypeClass(Type *T, raw_ostream &OS) {
+  if (T->isIntegerTy(1))
+    OS << "b";
+  else if (T->isIntegerTy())
+    OS << "i";
+  else if (T->isFloatingPointTy())
+    OS << "f";
+  else if (T->isPointerTy())
+    OS << "p";
+  else if (T->isVoidTy())
+    OS << "v";
+  else if (T->isLabelTy())
+    OS << "l";
+  else if (auto *VT = dyn_cast<FixedVectorType>(T)) {
+    OS << "<" << VT->getNumElements() << "x";
+    printTypeClass(VT->getElementType(), OS);
+    OS << ">";
+  } else if (auto *AT = dyn_cast<ArrayType>(T)) {
+    OS << "[";
+    printTypeClass(AT->getElementType(), OS);
+    OS << "]";
+  } else if (auto *ST = dyn_cast<StructType>(T)) {
+    OS << "{";
+    for (Type *E : ST->elements())
+      printTypeClass(E, OS);
+    OS << "}";
+  } else
+    OS << "?";
+}
+
+// Nest shape: header position and block count of every loop, in preorder
+static void printNestShape(Loop *L,
+                           std::unordered_map<const Value *, unsigned> &Ids,
+                           raw_ostream &OS) {
+  OS << "L" << Ids[L->getHeader()] << "/" << L->getNumBlocks() << "(";
+  for (Loop *SubLoop : L->getSubLoops())
+    printNestShape(SubLoop, Ids, OS);
+  OS << ")";
+}
+
+uint64_t loopFingerprint(Loop *L) {
+  // Blocks and instructions of the nest are numbered in visiting order, so
+  // operands (including phi operands defined later) can be written by
+  // position instead of by name
+  std::unordered_map<const Value *, unsigned> Ids;
+  for (BasicBlock *BB : L->getBlocks()) {
+    Ids.emplace(BB, Ids.size());
+    for (Instruction &I : *BB)
+      if (!isa<DbgInfoIntrinsic>(&I))
+        Ids.emplace(&I, Ids.size());
+  }
+
+  // Globals and values defined before the nest are numbered by their first
+  // use, so nests touching different (or the same) arrays hash differently
+  std::unordered_map<const Value *, unsigned> Globals, Outside;
+
+  std::string Tokens;
+  raw_string_ostream OS(Tokens);
+  printNestShape(L, Ids, OS);
+  OS << "\n";
+
+  for (BasicBlock *BB : L->getBlocks()) {
+    for (Instruction &I : *BB) {
+      // Debug info does not change the structure of the nest
+      if (isa<DbgInfoIntrinsic>(&I))
+        continue;
+
+      OS << I.getOpcodeName();
+      if (auto *Cmp = dyn_cast<CmpInst>(&I))
+        OS << "." << CmpInst::getPredicateName(Cmp->getPredicate());
+      OS << ":";
+      printTypeClass(I.getType(), OS);
+
+      for (Value *Op : I.operands()) {
+        OS << " ";
+        auto Id = Ids.find(Op);
+        if (Id != Ids.end())
+          OS << "%" << Id->second;
+        else if (isa<BasicBlock>(Op))
+          OS << "exit";
+        else if (auto *A = dyn_cast<Argument>(Op))
+          OS << "arg" << A->getArgNo();
+        else if (isa<GlobalValue>(Op))
+          OS << "g" << Globals.emplace(Op, Globals.size()).first->second;
+        else if (auto *C = dyn_cast<ConstantInt>(Op))
+          OS << C->getValue();
+        else if (isa<Constant>(Op))
+          OS << "const";
+        else
+          // Defined outside the nest
+          OS << "o" << Outside.emplace(Op, Outside.size()).first->second;
+        printTypeClass(Op->getType(), OS);
+      }
+      OS << "\n";
+    }
+  }
+
+  return xxHash64(OS.str());
+}
+
+enum RegClass : unsigned char { NoReg, IntReg, FPReg, VectorReg };
+
+static RegClass regClass(Type *T) {
+  if (T->isVectorTy())
+    return VectorReg;
+  if (T->isFloatingPointTy())
+    return FPReg;
+  if (T->isIntegerTy() || T->isPointerTy())
+    return IntReg;
+  return NoReg;
+}
+
+RegisterPressure LoopLiveness::estimate(Loop *L) {
+  ValueIds.clear();
+  BlockIds.clear();
+  Invariants.clear();
+  Classes.clear();
+  unsigned InvariantCount[4] = {0};
+
+  // Number the blocks and the values defined in the loop
+  ArrayRef<BasicBlock *> Blocks = L->getBlocks();
+  for (BasicBlock *BB : Blocks) {
+    unsigned b = BlockIds.size();
+    BlockIds[BB] = b;
+    for (Instruction &I : *BB) {
+      RegClass C = regClass(I.getType());
+      if (C == NoReg)
+        continue;
+      unsigned v = Classes.size();
+      ValueIds[&I] = v;
+      Classes.push_back(C);
+    }
+  }
+
+  unsigned NumBlocks = Blocks.size(), NumValues = Classes.size();
+  for (std::vector<BitVector> *Sets : {&Use, &Def, &LiveIn, &LiveOut}) {
+    if (Sets->size() < NumBlocks)
+      Sets->resize(NumBlocks);
+    for (unsigned b = 0; b < NumBlocks; ++b) {
+      (*Sets)[b].clear();
+      (*Sets)[b].resize(NumValues);
+    }
+  }
+  ExitLive.clear();
+  ExitLive.resize(NumValues);
+
+  // Upward exposed uses and definitions of every block. Values from outside
+  // the loop are not tracked in the bitsets: they are live everywhere in it,
+  // except for phi operands coming from outside (e.g. initial values).
+  for (BasicBlock *BB : Blocks) {
+    unsigned b = BlockIds[BB];
+    for (Instruction &I : *BB) {
+      PHINode *PN = dyn_cast<PHINode>(&I);
+      for (unsigned i = 0; i < I.getNumOperands(); ++i) {
+        Value *Op = I.getOperand(i);
+        auto Id = ValueIds.find(Op);
+        if (Id != ValueIds.end()) {
+          if (!PN && !Def[b].test(Id->second))
+            Use[b].set(Id->second);
+          continue;
+        }
+
+        if (PN && !L->contains(PN->getIncomingBlock(i)))
+          continue;
+        Instruction *OpI = dyn_cast<Instruction>(Op);
+        if (!(isa<Argument>(Op) || (OpI && !L->contains(OpI))))
+          continue;
+        RegClass C = regClass(Op->getType());
+        if (C != NoReg && Invariants.insert(Op).second)
+          InvariantCount[C]++;
+      }
+
+      auto Id = ValueIds.find(&I);
+      if (Id == ValueIds.end())
+        continue;
+      Def[b].set(Id->second);
+
+      // Uses by the LCSSA phis of exit blocks are live on their exit edge
+      // only (see below); any other use after the loop keeps the value live
+      // out of every exiting block
+      for (llvm::Use &U : I.uses()) {
+        Instruction *UserI = cast<Instruction>(U.getUser());
+        if (L->contains(UserI))
+          continue;
+        PHINode *UserPN = dyn_cast<PHINode>(UserI);
+        if (!UserPN || !L->contains(UserPN->getIncomingBlock(U))) {
+          ExitLive.set(Id->second);
+          break;
+        }
+      }
+    }
+  }
+
+  // Backward dataflow until the live-in sets are stable:
+  //   LiveOut(B) = U LiveIn(S) + phi operands of S coming from B
+  //   LiveIn(B) = Use(B) + (LiveOut(B) - Def(B))
+  // where LiveIn of an exit block S is ExitLive
+  bool Changed = true;
+  while (Changed) {
+    Changed = false;
+    for (BasicBlock *BB : reverse(Blocks)) {
+      unsigned b = BlockIds[BB];
+      BitVector &Out = LiveOut[b];
+      for (BasicBlock *Succ : successors(BB)) {
+        auto SuccId = BlockIds.find(Succ);
+        if (SuccId == BlockIds.end())
+          Out |= ExitLive;
+        else
+          Out |= LiveIn[SuccId->second];
+        for (PHINode &PN : Succ->phis()) {
+          auto Id = ValueIds.find(PN.getIncomingValueForBlock(BB));
+          if (Id != ValueIds.end())
+            Out.set(Id->second);
+        }
+      }
+
+      Live = Out;
+      Live.reset(Def[b]);
+      Live |= Use[b];
+      if (Live != LiveIn[b]) {
+        LiveIn[b] = Live;
+        Changed = true;
+      }
+    }
+  }
+
+  // Walk every block backwards from its live-out set and keep the largest
+  // live count of each class
+  unsigned Max[4] = {0};
+  for (BasicBlock *BB : Blocks) {
+    Live = LiveOut[BlockIds[BB]];
+    unsigned Count[4] = {0};
+    for (unsigned v : Live.set_bits())
+      Count[Classes[v]]++;
+
+    for (Instruction &I : reverse(*BB)) {
+      for (unsigned c = 0; c < 4; ++c)
+        Max[c] = std::max(Max[c], Count[c]);
+
+      auto Id = ValueIds.find(&I);
+      if (Id != ValueIds.end() && Live.test(Id->second)) {
+        Live.reset(Id->second);
+        Count[Classes[Id->second]]--;
+      }
+      if (isa<PHINode>(&I))
+        continue;
+      for (Value *Op : I.operands()) {
+        auto OpId = ValueIds.find(Op);
+        if (OpId != ValueIds.end() && !Live.test(OpId->second)) {
+          Live.set(OpId->second);
+          Count[Classes[OpId->second]]++;
+        }
+      }
+    }
+    for (unsigned c = 0; c < 4; ++c)
+      Max[c] = std::max(Max[c], Count[c]);
+  }
+
+  RegisterPressure RP;
+  RP.MaxInt = Max[IntReg] + InvariantCount[IntReg];
+  RP.MaxFP = Max[FPReg] + InvariantCount[FPReg];
+  RP.MaxVector = Max[VectorReg] + InvariantCount[VectorReg];
+  RP.Invariants = Invariants.size();
+  return RP;
+}
+
+void collectLoopFeatures(Loop *L, ScalarEvolution &SE, const std::string &Path,
+                         std::unordered_map<std::string, unsigned> &Seen,
+                         std::vector<LoopFeatures> &Out) {
+
+  LoopFeatures LF;
+  LF.Depth = L->getLoopDepth();
+  LF.TripCount = SE.getSmallConstantTripCount(L);
+
+  for (BasicBlock *BB : L->getBlocks()) {
+    for (Instruction &I : *BB) {
+      if (isa<BinaryOperator>(&I))
+        ++LF.BinOps[I.getOpcodeName()];
+
+      if (int step = arrayRefUsers(&I))
+        classifyIndexExpr(&I, step, LF.IdxExpr);
+    }
+  }
+
+  LF.Key = uniqueLoopId(L, Path, Seen);
+  LF.Location = loopLocation(L);
+  Out.push_back(std::move(LF));
+
+  unsigned nest = 0;
+  for (Loop *SubLoop : L->getSubLoops())
+    collectLoopFeatures(SubLoop, SE, Path + "." + std::to_string(++nest), Seen,
+                        Out);
+}
+
+std::vector<LoopFeatures> collectModuleFeatures(Module &M) {
+  std::vector<LoopFeatures> Features;
+  std::unordered_map<std::string, unsigned> Seen;
+  TargetLibraryInfoImpl TLII(Triple(M.getTargetTriple()));
+
+  for (Function &F : M) {
+    if (F.isDeclaration())
+      continue;
+
+    DominatorTree DT(F);
+    LoopInfo LI(DT);
+    TargetLibraryInfo TLI(TLII, &F);
+    AssumptionCache AC(F);
+    ScalarEvolution SE(F, TLI, AC, DT, LI);
+
+    unsigned loopCounter = 0;
+    for (Loop *L : LI)
+      collectLoopFeatures(L, SE, std::to_string(++loopCounter), Seen,
+                          Features);
+  }
+  return Features;
+}
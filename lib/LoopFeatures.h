@@ -0,0 +1,126 @@
+#ifndef STATSCOUNT_LOOPFEATURES_H
+#define STATSCOUNT_LOOPFEATURES_H
+
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/IR/Instruction.h"
+
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace llvm {
+class Module;
+}
+
+// Per-loop features that can be collected without printing anything, so they
+// can be gathered off the main thread and compared across builds.
+struct LoopFeatures {
+  // Loop ID (see uniqueLoopId), the same one stCounter prints and indexes
+  std::string Key;
+  // Header location (see loopLocation), empty without debug info
+  std::string Location;
+  unsigned Depth = 0;
+  // 0 when the trip count is not a small constant
+  unsigned TripCount = 0;
+  // Binary operation name => frequency in the loop (subloops included)
+  std::map<std::string, int> BinOps;
+  //      [0] ==> Linear Expressions (e.g. array[i])
+  //      [1] ==> Constant Shift (e.g. array[i+1])
+  //      [2] ==> Parametric Shift (e.g. array[i+M])
+  //      [3] ==> Skewed (e.g. array[i+j])
+  int IdxExpr[4] = {0};
+};
+
+// Estimated register pressure of one loop
+struct RegisterPressure {
+  // Maximum number of simultaneously live SSA values per register class
+  // (pointers count as integers), loop-invariant values included
+  unsigned MaxInt = 0;
+  unsigned MaxFP = 0;
+  unsigned MaxVector = 0;
+  // Values defined before the loop and used inside it, which stay live across
+  // the whole loop
+  unsigned Invariants = 0;
+};
+
+// Dense bitset liveness over the blocks of one loop. The bitsets and maps are
+// kept between calls, so estimating sibling loops one after the other reuses
+// their storage instead of reallocating it.
+class LoopLiveness {
+public:
+  RegisterPressure estimate(llvm::Loop *L);
+
+private:
+  llvm::DenseMap<const llvm::Value *, unsigned> ValueIds;
+  llvm::DenseMap<const llvm::BasicBlock *, unsigned> BlockIds;
+  llvm::SmallPtrSet<const llvm::Value *, 16> Invariants;
+  // Register class of every numbered value
+  std::vector<unsigned char> Classes;
+  std::vector<llvm::BitVector> Use, Def, LiveIn, LiveOut;
+  // Values defined in the loop and used after it other than by the LCSSA
+  // phi of an exit edge
+  llvm::BitVector ExitLive;
+  llvm::BitVector Live;
+};
+
+// Recursively visit a binary operation used in an index expression and
+// collect:
+//        localStats[0] ==> Number of induction variables visited
+//        localStats[1] ==> Number of constants
+//        localStats[2] ==> Number of parametric vars
+void visitBinOpInstr(llvm::Instruction *BinOpInstr, int (&localStats)[3]);
+
+// Number of array references made through I, as counted by findArrayRefs: the
+// users of I when it is a GEP into an array type, 0 otherwise.
+int arrayRefUsers(llvm::Instruction *I);
+
+// Classify the last index operand of a GEP into idxExpressionCounter, counting
+// it `step` times (once per user of the GEP).
+void classifyIndexExpr(llvm::Instruction *GEP, int step,
+                       int (&idxExpressionCounter)[4]);
+
+// Header location of L as "file:line:col", or an empty string if the loop
+// carries no debug location.
+std::string loopLocation(llvm::Loop *L);
+
+// Stable ID of L: "function|loc>loc>..." with the header locations of L and
+// its enclosing loops, outermost first. Path (the ordinal position, e.g.
+// "1.2") replaces the locations when L has no debug location.
+std::string loopId(llvm::Loop *L, const std::string &Path);
+
+// loopId made unique within a run: the n-th loop seen with an already used ID
+// gets "#n" appended. Seen holds the number of loops seen with each ID.
+std::string uniqueLoopId(llvm::Loop *L, const std::string &Path,
+                         std::unordered_map<std::string, unsigned> &Seen);
+
+// Lines of the header's source file covered by the loop ("file:first-last"),
+// or an empty string without debug info.
+std::string loopSourceRange(llvm::Loop *L);
+
+// Names of the loop's blocks, header first, separated by commas.
+std::string loopBlockNames(llvm::Loop *L);
+
+// Structural fingerprint of the loop nest rooted at L, computed in one pass
+// over its blocks. Value names are ignored and types are reduced to their
+// class (integer widths, FP precisions, pointee types and array lengths are
+// dropped), so instantiations of the same template nest hash equal.
+uint64_t loopFingerprint(llvm::Loop *L);
+
+// Append the features of L and of all its subloops to Out, in preorder. Path
+// is the loop's ordinal position in the function (e.g. "1.2").
+void collectLoopFeatures(llvm::Loop *L, llvm::ScalarEvolution &SE,
+                         const std::string &Path,
+                         std::unordered_map<std::string, unsigned> &Seen,
+                         std::vector<LoopFeatures> &Out);
+
+// Build the analyses for every defined function of M and collect the
+// features of all of its loops, in module order. Only touches M's context, so
+// two modules in different contexts can be processed concurrently.
+std::vector<LoopFeatures> collectModuleFeatures(llvm::Module &M);
+
+#endif
@@ -1,3 +1,6 @@
+#include "LoopFeatures.h"
+
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/Analysis/LoopInfo.h"
 #include "llvm/Analysis/LoopNestAnalysis.h"
 #include "llvm/Analysis/ScalarEvolution.h"
@@ -5,9 +8,15 @@
 #include "llvm/IR/Function.h"
 #include "llvm/Pass.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <map>
 #include <unordered_map>
 #include <vector>
 using namespace llvm;
@@ -29,12 +38,120 @@ static cl::opt<bool>
 static cl::opt<bool>
     BinOps("bin-ops", cl::desc("Enable Printing Binary Operations Frequency"));
 
+enum SampleUnitKind { SampleFunctions, SampleLoops };
+
+static cl::opt<double> SampleRate(
+    "sample-rate",
+    cl::desc("Analyze only this fraction of functions (or loop nests) and "
+             "print scaled corpus estimates at the end"),
+    cl::init(1.0), cl::cb<void, double>([](double rate) {
+      if (!(rate > 0 && rate <= 1)) {
+        errs() << "stCounter: -sample-rate must be in (0, 1]\n";
+        exit(1);
+      }
+    }));
+
+static cl::opt<unsigned>
+    SampleSeed("sample-seed", cl::desc("Seed used to pick the sampled units"),
+               cl::init(0));
+
+static cl::opt<SampleUnitKind> SampleUnit(
+    "sample-unit", cl::desc("Unit sampled by -sample-rate"),
+    cl::values(clEnumValN(SampleFunctions, "function", "Sample functions"),
+               clEnumValN(SampleLoops, "loop",
+                          "Sample loop nests, stratified by depth")),
+    cl::init(SampleFunctions));
+
+static cl::opt<bool> RegPressure(
+    "reg-pressure",
+    cl::desc("Enable Printing Register Pressure and Live Value Estimates"));
+
+static cl::opt<std::string> LoopIndex(
+    "loop-index",
+    cl::desc("Write a sorted index from loop ID to source range and IR block "
+             "names (one tab separated line per loop) to this file"),
+    cl::value_desc("filename"));
+
+static cl::opt<bool> Dedup(
+    "dedup",
+    cl::desc("Reuse the analysis of a loop nest for every later nest with the "
+             "same structural fingerprint"));
+
 namespace {
 
 struct StatsCount : public FunctionPass {
   static char ID;
   StatsCount() : FunctionPass(ID) {}
 
+  // Sums over the sampled units of one counter, used to scale the summary
+  // counters when -sample-rate < 1
+  struct SampleSums {
+    int Units = 0;
+    double Sum = 0, SumSq = 0;
+    void add(double y) {
+      Units++;
+      Sum += y;
+      SumSq += y * y;
+    }
+  };
+
+  // Function sampling: per-function counters of the sampled functions
+  int seenFunctions = 0;
+  SampleSums sampledTotal, sampledNested, sampledDisjoint, sampledTriangular;
+  // Cross sum of total and disjoint loops (for the average depth ratio)
+  double sampledTotalDisjoint = 0;
+
+  // Loop sampling: loop nests are stratified by depth, and everything but the
+  // triangular count is exact since it only needs LoopInfo
+  std::map<unsigned, int> strataSizes;
+  std::map<unsigned, SampleSums> strataTriangular;
+  int corpusTotal = 0, corpusNested = 0, corpusDisjoint = 0;
+
+  // Name-free features of an analyzed loop nest, reused by structurally
+  // identical nests when -dedup is given
+  struct NestRecord {
+    // Loop ID of the nest the record was built from
+    std::string Origin;
+    std::unordered_map<std::string, int> BinOps;
+    int IdxExpr[4] = {0};
+    std::vector<bool> TriangularNests;
+    // Outer loop first, then its subloops (only with -reg-pressure)
+    std::vector<RegisterPressure> Pressure;
+  };
+
+  // Fingerprint => first nest analyzed with it, shared by all functions
+  std::unordered_map<uint64_t, NestRecord> nestRecords;
+
+  // "ID\tsource range\tblock names" of every loop, sampled or not, written
+  // sorted by ID to -loop-index at the end of the run
+  std::vector<std::string> indexEntries;
+  // Number of loops seen with each ID, to tell apart loops sharing a location
+  std::unordered_map<std::string, unsigned> idCounts;
+  // ID of every loop of the current function
+  DenseMap<Loop *, std::string> loopIds;
+
+  // Assign IDs to L and its subloops in preorder (as collectLoopFeatures
+  // does) and add them to the index
+  void indexLoop(Loop *L, const std::string &path) {
+    std::string id = uniqueLoopId(L, path, idCounts);
+    if (!LoopIndex.empty())
+      indexEntries.push_back(id + "\t" + loopSourceRange(L) + "\t" +
+                             loopBlockNames(L));
+    loopIds[L] = id;
+
+    int nest = 0;
+    for (Loop *SubLoop : L->getSubLoops())
+      indexLoop(SubLoop, path + "." + std::to_string(++nest));
+  }
+
+  // Deterministic per-unit decision, independent of the visiting order
+  bool isSampled(const Twine &Unit) {
+    if (SampleRate >= 1.0)
+      return true;
+    uint64_t h = xxHash64((Twine(SampleSeed) + ":" + Unit).str());
+    return (h >> 11) * 0x1.0p-53 < SampleRate;
+  }
+
   void getAnalysisUsage(AnalysisUsage &AU) const {
     AU.addRequired<LoopInfoWrapperPass>();
     AU.addRequired<ScalarEvolutionWrapperPass>();
@@ -69,66 +186,73 @@ struct StatsCount : public FunctionPass {
     return false;
   }
 
-  // A function that recursively visits binary operation instructions.
-  // Starts with one binop instr, and inspects its operands. If any of them
-  // is the result of another binop inst, it visits that other instruction and
-  // so on, until the level where the operands of the binops instruction are
-  // either constants, induction variables, or parametric vars. During these
-  // visits, it collects `localStats` as follows:
-  //        localStats[0] ==> Number of induction variables visited
-  //        localStats[1] ==> Number of constants
-  //        localStats[2] ==> Number of parametric vars
-
-  void visitBinOpInstr(Instruction *BinOpInstr, int (&localStats)[3]) {
-
-    for (int i = 0; i < BinOpInstr->getNumOperands(); ++i) {
-
-      Value *currentOperand = BinOpInstr->getOperand(i);
-
-      if (isa<BinaryOperator>(currentOperand)) {
-
-        Instruction *currentOperandAsInstr = cast<Instruction>(currentOperand);
-        visitBinOpInstr(currentOperandAsInstr, localStats);
-
-      } else {
-
-        if (isa<ConstantData>(currentOperand)) {
-
-          // Increment number of constants in the expression
-          localStats[1]++;
-        } else {
-
-          if (isa<PHINode>(currentOperand)) {
-
-            // Increment PHINodes count
-            localStats[0]++;
-          } else {
-
-            // Increment Parametric
-            localStats[2]++;
-          }
-        }
+  // Adds the references made through the GEP Ip to refMap (array name =>
+  // number of refs, type) and returns its number of users. refCount counts the
+  // users inside L.
+  int addArrayRef(
+      Loop *L, Instruction *Ip,
+      std::unordered_map<std::string, std::pair<int, std::string>> &refMap,
+      int &refCount) {
+    int idxExpressionCountStep = 0;
+
+    // Get the name of the array
+    std::string arrayName = (*(Ip->getOperand(0))).getName().str();
+
+    Type *T = cast<PointerType>(
+                  cast<GetElementPtrInst>(Ip)->getPointerOperandType())
+                  ->getElementType();
+
+    if (isa<ArrayType>(T)) {
+
+      // errs() << "Operand 0: " << (*(Ip->getOperand(0))).getName() <<
+      // "\n"; errs() << "T is " << *T << "\n";
+
+      // convert type to string
+      std::string type_str;
+      llvm::raw_string_ostream rso(type_str);
+      T->print(rso);
+      // std::cout << rso.str();
+
+      refMap.emplace(std::make_pair(arrayName, std::make_pair(0, type_str)));
+      for (User *U : Ip->users()) {
+        // errs() << "User " << *U << "\n";
+        if (instInLoop(L, cast<Instruction>(U)))
+          refCount++;
+        ++(refMap[arrayName].first);
+        ++idxExpressionCountStep;
       }
     }
+    return idxExpressionCountStep;
   }
 
-  int findArrayRefs(
+  // Rebuilds refMap for a nest whose other features come from a -dedup
+  // record, since array names and types differ between reused nests
+  int collectArrayRefs(
       Loop *L,
       std::unordered_map<std::string, std::pair<int, std::string>> &refMap) {
+    int refCount = 0;
+    for (BasicBlock *BB : L->getBlocks())
+      for (Instruction &I : *BB)
+        if (isa<GetElementPtrInst>(&I))
+          addArrayRef(L, &I, refMap, refCount);
+    return refCount;
+  }
 
-    // A map to store binary operations names and frequency
-    std::unordered_map<std::string, int> binOps;
+  // binOps collects binary operations names and frequency, and
+  // idxExpressionCounter stores 4 values for different array access types:
+  //      [0] ==> Linear Expressions (e.g. array[i])
+  //      [1] ==> Constant Shift (e.g. array[i+1])
+  //      [2] ==> Parametric Shift (e.g. array[i+M])
+  //      [3] ==> Skewed (e.g. array[i+j]):
+  int findArrayRefs(
+      Loop *L,
+      std::unordered_map<std::string, std::pair<int, std::string>> &refMap,
+      std::unordered_map<std::string, int> &binOps,
+      int (&idxExpressionCounter)[4]) {
 
     // A counter to store the number of conditionals
     int conditionals = 0;
 
-    // An array that stores 4 values for different array access types:
-    //      [0] ==> Linear Expressions (e.g. array[i])
-    //      [1] ==> Constant Shift (e.g. array[i+1])
-    //      [2] ==> Parametric Shift (e.g. array[i+M])
-    //      [3] ==> Skewed (e.g. array[i+j]):
-    int idxExpressionCounter[4] = {0};
-
     int refCount = 0;
 
     // Loop latch compare instructions (used while counting conditionals)
@@ -174,36 +298,12 @@ struct StatsCount : public FunctionPass {
           // For example: if we have a[i+1] += 5;
           // then we will count the index expression [i+1] twice as a constant
           // shift expression
-          int idxExpressionCountStep = 0;
+          int idxExpressionCountStep = addArrayRef(L, Ip, refMap, refCount);
 
           // Get the name of the array
           std::string arrayName = (*(Ip->getOperand(0))).getName().str();
 
-          Type *T = cast<PointerType>(
-                        cast<GetElementPtrInst>(Ip)->getPointerOperandType())
-                        ->getElementType();
-
-          if (isa<ArrayType>(T)) {
-
-            // errs() << "Operand 0: " << (*(Ip->getOperand(0))).getName() <<
-            // "\n"; errs() << "T is " << *T << "\n";
-
-            // convert type to string
-            std::string type_str;
-            llvm::raw_string_ostream rso(type_str);
-            T->print(rso);
-            // std::cout << rso.str();
-
-            refMap.emplace(
-                std::make_pair(arrayName, std::make_pair(0, type_str)));
-            for (User *U : Ip->users()) {
-              // errs() << "User " << *U << "\n";
-              if (instInLoop(L, cast<Instruction>(U)))
-                refCount++;
-              ++(refMap[arrayName].first);
-              ++idxExpressionCountStep;
-            }
-          }
+          classifyIndexExpr(Ip, idxExpressionCountStep, idxExpressionCounter);
           if (ArrIdx) {
             int gepNumOperands = Ip->getNumOperands();
             // errs() << "GEP instruction is " << *Ip << "\n";
@@ -213,75 +313,11 @@ struct StatsCount : public FunctionPass {
             // Get the GEP index expression (operand)
             Value *gepOperand = (Ip->getOperand(gepNumOperands - 1));
 
-            // Check if the GEP expression is an instruction
-            if (isa<Instruction>(gepOperand)) {
-              // errs() << "GEP operand is an instruction \n";
-
-              // If it is, cast it to Instruction
-              Instruction *gepOperandI = cast<Instruction>(gepOperand);
-
-              // Now, analyze this instruction
-              // First, get the number of operands of that instruction
-              // (it is noticed that this instruction is usually a sext
-              // instr which has only one operand)
-              int idxInstrNumOperands = gepOperandI->getNumOperands();
-              for (int i = 0; i < idxInstrNumOperands; ++i) {
-                // Get the operand of the instruction (sext instr.)
-                Value *gepOperandIOperand = gepOperandI->getOperand(i);
-
-                // If this operand is a Phi Node, most likely it is
-                // the induction variable of the loop (i or j, etc.)
-                if (isa<PHINode>(gepOperandIOperand)) {
-                  // errs() << "Opernad Is a PHI node\n";
-                  //  Increment Linear Expressions Counter
-                  idxExpressionCounter[0] += idxExpressionCountStep;
-                } else if (isa<BinaryOperator>(gepOperandIOperand)) {
-                  Instruction *binaryIdxInstr =
-                      cast<Instruction>(gepOperandIOperand);
-
-                  // This is an array which will collect local stats inside
-                  // recursive calls of visitBinOpInstr The indices store values
-                  // as follows:
-                  //      localStats[0] ==> The number of induction variables
-                  //      localStats[1] ==> The number of constants
-                  //      localStats[2] ==> The number of parametric vars
-                  int localStats[] = {0, 0, 0};
-
-                  // This is the function that visit the binary operation
-                  // instruction of the index expression and recursively visit
-                  // its operands if they're binary operations as well to
-                  // identify the index access expression
-                  //
-                  // For example, if GEP operand was %idxprom
-                  // and
-                  // %idxprom = add nsw i32 %add4, %add3 --> (1)
-                  //
-                  // This function starts by visiting instr (1), then looks at
-                  // the operands (%add4 , %add3). If either (or both) are also
-                  // binary operations, it visit each of them recursively, and
-                  // so on until we reach the last level, where the operand are
-                  // no longer values produced by other binary operators
-                  // (constants, induction variables, or parametric variables)
-                  visitBinOpInstr(binaryIdxInstr, localStats);
-
-                  // Now, parse local stats collected during the recursive calls
-                  // and reflect them into the global stats
-
-                  if (localStats[0] > 1) {
-                    idxExpressionCounter[3] += idxExpressionCountStep;
-                  }
-
-                  if (localStats[1] > 0) {
-                    idxExpressionCounter[1] += idxExpressionCountStep;
-                  }
-                  if (localStats[2] > 0) {
-                    idxExpressionCounter[2] += idxExpressionCountStep;
-                  }
-                }
-
+            // Print the operands of the index expression instruction
+            if (Instruction *gepOperandI = dyn_cast<Instruction>(gepOperand)) {
+              for (int i = 0; i < gepOperandI->getNumOperands(); ++i)
                 errs() << "Operand " << i << " : "
                        << *(gepOperandI->getOperand(i)) << "\n";
-              }
             }
 
             errs() << "array: " << arrayName
@@ -333,7 +369,39 @@ struct StatsCount : public FunctionPass {
     return refCount;
   }
 
-  void printIdxExpSummary(int (&idxExpressionCounter)[4]) {
+  void printPressure(const RegisterPressure &RP) {
+    errs() << "Max Live Values (int/fp/vector): " << RP.MaxInt << " / "
+           << RP.MaxFP << " / " << RP.MaxVector << "\n";
+    errs() << "Loop-Invariant Live Values: " << RP.Invariants << "\n";
+  }
+
+  void printNestRecord(Loop *L, const NestRecord &record,
+                       const std::vector<std::string> &nestIds) {
+    errs() << "Reusing analysis of loop " << record.Origin << "\n";
+    if (RegPressure)
+      printPressure(record.Pressure[0]);
+    if (ArrIdx)
+      printIdxExpSummary(record.IdxExpr);
+    if (BinOps)
+      printOpMap(record.BinOps);
+    if (ArrRef) {
+      std::unordered_map<std::string, std::pair<int, std::string>> refMap;
+      int loopArrRefs = collectArrayRefs(L, refMap);
+      errs() << "Number of Array References: " << loopArrRefs << "\n";
+      printMap(refMap);
+    }
+    for (size_t nest = 0; nest < record.TriangularNests.size(); ++nest) {
+      errs() << "Analyzing loop nest " << nest + 1 << "\n";
+      errs() << "Loop ID: " << nestIds[nest] << "\n";
+      if (record.TriangularNests[nest])
+        errs() << "Triangular Loop\n";
+      if (RegPressure)
+        printPressure(record.Pressure[nest + 1]);
+    }
+    errs() << "=============================\n";
+  }
+
+  void printIdxExpSummary(const int (&idxExpressionCounter)[4]) {
 
     errs() << "\nLoop Nest Array Access Pattern Summary\n=================\n";
 
@@ -552,12 +620,27 @@ struct StatsCount : public FunctionPass {
 
     // errs() << "Data layout: " << dataLayout << "\n";
 
+    LoopInfo &LI = getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+
+    // Every loop gets its ID before anything is skipped by sampling, so the
+    // IDs do not depend on -sample-rate and -sample-seed
+    loopIds.clear();
+    int topLevel = 0;
+    for (Loop *L : LI)
+      indexLoop(L, std::to_string(++topLevel));
+
+    seenFunctions++;
+    if (SampleUnit == SampleFunctions && !isSampled(F.getName()))
+      return false;
+
     errs() << "Function " << F.getName() << '\n';
     errs() << "-----------------\n";
-    LoopInfo &LI = getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
 
     ScalarEvolution *se = &getAnalysis<ScalarEvolutionWrapperPass>().getSE();
 
+    // Liveness bitsets, reused by every loop of the function
+    LoopLiveness liveness;
+
     int loopCounter = 0;
     int totalLoops = 0, nestedLoops = 0, disjointLoops = 0;
     double avgDepth = 0;
@@ -570,7 +653,6 @@ struct StatsCount : public FunctionPass {
       avgDepth++;
 
       int loopDepth = 1;
-      errs() << "Analyzing loop " << loopCounter << "\n";
       // countBlocksInLoop(*i, 0);
       std::vector<Loop *> subLoops = (*i)->getSubLoops();
 
@@ -580,15 +662,55 @@ struct StatsCount : public FunctionPass {
         avgDepth += subLoops.size();
       }
 
+      if (SampleUnit == SampleLoops) {
+        strataSizes[subLoops.size() + 1]++;
+        if (!isSampled(F.getName() + ":" + Twine(loopCounter)))
+          continue;
+      }
+      int nestTriangular = triangularLoops;
+
+      std::string loopID = loopIds[*i];
+      std::vector<std::string> nestIds;
+      for (Loop *SubLoop : subLoops)
+        nestIds.push_back(loopIds[SubLoop]);
+
+      errs() << "Analyzing loop " << loopCounter << "\n";
+      errs() << "Loop ID: " << loopID << "\n";
       errs() << "Loop Depth: " << subLoops.size() + 1 << "\n";
 
+      uint64_t fingerprint = loopFingerprint(*i);
+      errs() << "Loop Fingerprint: " << format_hex_no_prefix(fingerprint, 16)
+             << "\n";
+
+      if (Dedup) {
+        auto found = nestRecords.find(fingerprint);
+        if (found != nestRecords.end()) {
+          const NestRecord &record = found->second;
+          printNestRecord(*i, record, nestIds);
+          triangularLoops += std::count(record.TriangularNests.begin(),
+                                        record.TriangularNests.end(), true);
+          if (SampleUnit == SampleLoops)
+            strataTriangular[subLoops.size() + 1].add(triangularLoops -
+                                                      nestTriangular);
+          continue;
+        }
+      }
+
+      NestRecord record;
+      record.Origin = loopID;
+
       std::unordered_map<std::string, std::pair<int, std::string>> refMap;
 
-      int loopArrRefs = findArrayRefs(*i, refMap);
+      int loopArrRefs =
+          findArrayRefs(*i, refMap, record.BinOps, record.IdxExpr);
       if (ArrRef) {
         errs() << "Number of Array References: " << loopArrRefs << "\n";
         printMap(refMap);
       }
+      if (RegPressure) {
+        record.Pressure.push_back(liveness.estimate(*i));
+        printPressure(record.Pressure.back());
+      }
       analyzeLoopBounds(*i, se, triangularLoops);
 
       Loop::iterator j, f;
@@ -596,6 +718,7 @@ struct StatsCount : public FunctionPass {
       for (j = subLoops.begin(), f = subLoops.end(); j != f; ++j) {
         nest++;
         errs() << "Analyzing loop nest " << nest << "\n";
+        errs() << "Loop ID: " << nestIds[nest - 1] << "\n";
 
         PHINode *indVar = (*j)->getInductionVariable(*se);
         if (indVar == nullptr) {
@@ -607,16 +730,26 @@ struct StatsCount : public FunctionPass {
         }
 
         bool tr = isTriangular(*i, *j, indVar, se);
+        record.TriangularNests.push_back(tr);
         if (tr) {
           triangularLoops++;
           errs() << "Triangular Loop\n";
         }
+        if (RegPressure) {
+          record.Pressure.push_back(liveness.estimate(*j));
+          printPressure(record.Pressure.back());
+        }
 
         analyzeLoopBounds(*j, se, triangularLoops);
         // bool x = tightlyNested(*i, *j);
         // errs() << (x?"Tightly nested":"Not tightly nested") << "\n";
         // errs() << "Induction Variable: " << (*indVar) << "\n";
       }
+      if (SampleUnit == SampleLoops)
+        strataTriangular[subLoops.size() + 1].add(triangularLoops -
+                                                  nestTriangular);
+      if (Dedup)
+        nestRecords.emplace(fingerprint, std::move(record));
       // errs() << "Loop Depth: " << loopDepth << "\n";
       /*
       Optional<Loop::LoopBounds> bounds = (*i)->getBounds(*se);
@@ -674,13 +807,160 @@ struct StatsCount : public FunctionPass {
     errs() << "Disjoint Loops Found: " << loopCounter << "\n";
     errs() << "Nested Loops: " << nestedLoops << "\n";
 
-    if (Triangular)
-      errs() << "Triangular Loops: " << triangularLoops << "\n";
-    errs() << "Rectangular Loops: " << nestedLoops - triangularLoops << "\n";
+    // Under loop sampling the triangular count only covers the sampled nests,
+    // it is reported scaled in the corpus estimates instead
+    if (SampleRate >= 1.0 || SampleUnit == SampleFunctions) {
+      if (Triangular)
+        errs() << "Triangular Loops: " << triangularLoops << "\n";
+      errs() << "Rectangular Loops: " << nestedLoops - triangularLoops
+             << "\n";
+    }
     errs() << "Average Loop Depth: " << avgDepth / loopCounter << "\n";
     errs() << "==============================================\n";
     errs() << "==============================================\n";
 
+    if (SampleUnit == SampleFunctions) {
+      sampledTotal.add(totalLoops);
+      sampledNested.add(nestedLoops);
+      sampledDisjoint.add(disjointLoops);
+      sampledTriangular.add(triangularLoops);
+      sampledTotalDisjoint += double(totalLoops) * disjointLoops;
+    } else {
+      corpusTotal += totalLoops;
+      corpusNested += nestedLoops;
+      corpusDisjoint += disjointLoops;
+    }
+
+    return false;
+  }
+
+  void printEstimate(const char *Name, double Estimate, double Variance) {
+    errs() << Name << ": " << format("%.2f", Estimate) << " +/- "
+           << format("%.2f", 1.96 * std::sqrt(Variance)) << "\n";
+  }
+
+  // Horvitz-Thompson estimate of a corpus total from Bernoulli sampled
+  // functions, with its variance
+  double scaleTotal(const SampleSums &S, double &Variance) {
+    double p = SampleRate;
+    Variance = (1 - p) / (p * p) * S.SumSq;
+    return S.Sum / p;
+  }
+
+  void printUnavailable(const char *Name, const std::string &reason) {
+    errs() << Name << ": unavailable (" << reason << ")\n";
+  }
+
+  void printFunctionEstimates() {
+    double varTotal, varNested, varDisjoint, varTriangular;
+    double total = scaleTotal(sampledTotal, varTotal);
+    double nested = scaleTotal(sampledNested, varNested);
+    double disjoint = scaleTotal(sampledDisjoint, varDisjoint);
+    double triangular = scaleTotal(sampledTriangular, varTriangular);
+
+    errs() << "Sampled Functions: " << sampledTotal.Units << " of "
+           << seenFunctions << "\n";
+
+    // The variance cannot be estimated from fewer than 2 sampled functions
+    if (sampledTotal.Units < 2 && sampledTotal.Units < seenFunctions) {
+      printUnavailable("Corpus Estimates", "fewer than 2 sampled functions");
+      return;
+    }
+    printEstimate("Total Loops", total, varTotal);
+    printEstimate("Disjoint Loops Found", disjoint, varDisjoint);
+    printEstimate("Nested Loops", nested, varNested);
+    if (Triangular)
+      printEstimate("Triangular Loops", triangular, varTriangular);
+
+    // Ratio estimator (total / disjoint) with its linearized variance
+    if (disjoint > 0) {
+      double p = SampleRate;
+      double r = total / disjoint;
+      double residuals = sampledTotal.SumSq - 2 * r * sampledTotalDisjoint +
+                         r * r * sampledDisjoint.SumSq;
+      printEstimate("Average Loop Depth", r,
+                    (1 - p) / (p * p) * residuals / (disjoint * disjoint));
+    }
+  }
+
+  void printLoopEstimates() {
+    int sampledNests = 0;
+    double triangular = 0, varTriangular = 0;
+    // Depths whose stratum was only partly sampled with fewer than 2 nests,
+    // so neither its total nor its variance can be estimated
+    std::string undersampled;
+
+    // Stratified estimate: scale each depth stratum by its own sampling
+    // fraction. A fully sampled stratum is exact, even with a single nest.
+    for (auto const &pair : strataSizes) {
+      const SampleSums &S = strataTriangular[pair.first];
+      double N = pair.second, n = S.Units;
+      sampledNests += S.Units;
+      if (n == N && n > 0) {
+        triangular += S.Sum;
+        continue;
+      }
+      if (n < 2) {
+        undersampled += (undersampled.empty() ? "" : ", ") +
+                        std::to_string(pair.first);
+        continue;
+      }
+      double mean = S.Sum / n;
+      double s2 = (S.SumSq - n * mean * mean) / (n - 1);
+      triangular += N * mean;
+      varTriangular += N * N * (1 - n / N) * s2 / n;
+    }
+
+    errs() << "Sampled Loop Nests: " << sampledNests << " of "
+           << corpusDisjoint << "\n";
+    errs() << "Total Loops: " << corpusTotal << "\n";
+    errs() << "Disjoint Loops Found: " << corpusDisjoint << "\n";
+    errs() << "Nested Loops: " << corpusNested << "\n";
+    if (Triangular) {
+      if (undersampled.empty())
+        printEstimate("Triangular Loops", triangular, varTriangular);
+      else
+        printUnavailable("Triangular Loops",
+                         "fewer than 2 sampled nests at depth " +
+                             undersampled);
+    }
+    if (corpusDisjoint > 0)
+      errs() << "Average Loop Depth: "
+             << format("%.2f", double(corpusTotal) / corpusDisjoint) << "\n";
+  }
+
+  void writeLoopIndex() {
+    std::error_code EC;
+    raw_fd_ostream OS(LoopIndex, EC, sys::fs::OF_Text);
+    if (EC) {
+      errs() << "stCounter: cannot write " << LoopIndex << ": "
+             << EC.message() << "\n";
+      return;
+    }
+
+    // Sorted by ID, so the file can be binary searched line by line
+    std::sort(indexEntries.begin(), indexEntries.end());
+    for (const std::string &entry : indexEntries)
+      OS << entry << "\n";
+  }
+
+  virtual bool doFinalization(Module &M) {
+    if (!LoopIndex.empty())
+      writeLoopIndex();
+
+    if (SampleRate >= 1.0)
+      return false;
+
+    errs() << "Sampled Corpus Estimates (rate "
+           << format("%g", SampleRate.getValue()) << ", seed " << SampleSeed
+           << ", 95% confidence)\n";
+    errs() << "==============================================\n";
+    if (SampleUnit == SampleFunctions)
+      printFunctionEstimates();
+    else
+      printLoopEstimates();
+    errs() << "==============================================\n";
+
     return false;
   }
 };
@@ -0,0 +1,210 @@
+#include "LoopFeatures.h"
+
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Scalar.h"
+#include "llvm/Transforms/Utils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+#include <future>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+using namespace llvm;
+
+static cl::opt<std::string>
+    DiffBase("diff-base",
+             cl::desc("Bitcode file to compare the input module's loops "
+                      "against (loops are matched by header location)"),
+             cl::value_desc("filename"));
+
+namespace {
+
+typedef std::vector<LoopFeatures> FeatureList;
+// Loops keyed by the location they are matched on
+typedef std::map<std::string, const LoopFeatures *> MatchMap;
+
+struct StatsDiff : public ModulePass {
+  static char ID;
+  StatsDiff() : ModulePass(ID) {}
+
+  void getAnalysisUsage(AnalysisUsage &AU) const { AU.setPreservesAll(); }
+
+  // Both modules go through the same canonicalization (the one
+  // build_and_run.sh applies before stCounter), whatever ran on the input
+  // before this pass, so their loops are compared in the same form
+  static std::vector<LoopFeatures> canonicalFeatures(Module &M) {
+    legacy::PassManager PM;
+    PM.add(createPromoteMemoryToRegisterPass());
+    PM.add(createLoopRotatePass());
+    PM.run(M);
+    return collectModuleFeatures(M);
+  }
+
+  void printDelta(const char *Name, long Base, long Current) {
+    if (Base == Current)
+      return;
+    errs() << Name << ": " << Base << " -> " << Current << " ("
+           << (Current > Base ? "+" : "") << Current - Base << ")\n";
+  }
+
+  // 0 stands for an unknown trip count
+  static std::string tripCount(unsigned TripCount) {
+    return TripCount ? std::to_string(TripCount) : "unknown";
+  }
+
+  void printTripCountDelta(unsigned Base, unsigned Current) {
+    if (Base == Current)
+      return;
+    if (!Base || !Current) {
+      errs() << "Trip Count: " << tripCount(Base) << " -> "
+             << tripCount(Current) << "\n";
+      return;
+    }
+    printDelta("Trip Count", Base, Current);
+  }
+
+  // Key every loop on its header location, so a loop is still matched when
+  // its depth changed (e.g. its enclosing loop was unrolled, or its function
+  // inlined). The n-th loop seen at an already used location gets "#n".
+  // Loops without a location are not guessed by position but left out and
+  // counted in Unmatchable.
+  MatchMap matchKeys(const FeatureList &Loops, int &Unmatchable) {
+    MatchMap Keys;
+    std::unordered_map<std::string, unsigned> Seen;
+    for (const LoopFeatures &LF : Loops) {
+      if (LF.Location.empty()) {
+        Unmatchable++;
+        continue;
+      }
+      std::string Key = LF.Location;
+      unsigned Count = Seen[Key]++;
+      if (Count)
+        Key += "#" + std::to_string(Count + 1);
+      Keys.emplace(Key, &LF);
+    }
+    return Keys;
+  }
+
+  void printLoop(const char *Status, const std::string &Key,
+                 const LoopFeatures &LF) {
+    errs() << Status << " loop\n";
+    errs() << "Loop Location: " << Key << "\n";
+    errs() << "Loop ID: " << LF.Key << "\n";
+    errs() << "Loop Depth: " << LF.Depth << "\n";
+    errs() << "Trip Count: " << tripCount(LF.TripCount) << "\n";
+    errs() << "=============================\n";
+  }
+
+  void printLoopDiff(const std::string &Key, const LoopFeatures &Base,
+                     const LoopFeatures &Current) {
+    errs() << "Matched loop\n";
+    errs() << "Loop Location: " << Key << "\n";
+    if (Base.Key == Current.Key)
+      errs() << "Loop ID: " << Current.Key << "\n";
+    else
+      errs() << "Loop ID: " << Base.Key << " -> " << Current.Key << "\n";
+
+    printDelta("Loop Depth", Base.Depth, Current.Depth);
+    printTripCountDelta(Base.TripCount, Current.TripCount);
+
+    // Union of the operations seen on both sides
+    std::map<std::string, int> ops = Base.BinOps;
+    for (auto const &pair : Current.BinOps)
+      ops.emplace(pair.first, 0);
+    for (auto const &pair : ops) {
+      auto b = Base.BinOps.find(pair.first);
+      auto c = Current.BinOps.find(pair.first);
+      printDelta(pair.first.c_str(), b == Base.BinOps.end() ? 0 : b->second,
+                 c == Current.BinOps.end() ? 0 : c->second);
+    }
+
+    printDelta("Linear Expressions", Base.IdxExpr[0], Current.IdxExpr[0]);
+    printDelta("Constant Shift Expressions", Base.IdxExpr[1],
+               Current.IdxExpr[1]);
+    printDelta("Parametric Shift Expressions", Base.IdxExpr[2],
+               Current.IdxExpr[2]);
+    printDelta("Skewed Shift Expressions", Base.IdxExpr[3], Current.IdxExpr[3]);
+    errs() << "=============================\n";
+  }
+
+  virtual bool runOnModule(Module &M) {
+    if (DiffBase.empty()) {
+      errs() << "stDiff: no baseline given, use -diff-base=<file>\n";
+      return false;
+    }
+
+    // The baseline lives in its own context, so it can be parsed, canonicalized
+    // and analyzed while the input module is being analyzed on this thread.
+    LLVMContext BaseContext;
+    std::unique_ptr<Module> BaseModule;
+    SMDiagnostic Err;
+    std::future<FeatureList> BaseFuture =
+        std::async(std::launch::async, [&]() {
+          BaseModule = parseIRFile(DiffBase, Err, BaseContext);
+          if (!BaseModule)
+            return FeatureList();
+          return canonicalFeatures(*BaseModule);
+        });
+
+    // The input is canonicalized on a copy, so this pass still preserves it
+    std::unique_ptr<Module> CurrentModule = CloneModule(M);
+    FeatureList CurrentLoops = canonicalFeatures(*CurrentModule);
+    FeatureList BaseLoops = BaseFuture.get();
+
+    if (!BaseModule) {
+      Err.print("stDiff", errs());
+      return false;
+    }
+
+    errs() << "Loop Diff: " << DiffBase << " -> "
+           << M.getModuleIdentifier() << "\n";
+    errs() << "-----------------\n";
+
+    int baseUnmatchable = 0, currentUnmatchable = 0;
+    MatchMap Base = matchKeys(BaseLoops, baseUnmatchable);
+    MatchMap Current = matchKeys(CurrentLoops, currentUnmatchable);
+    if (baseUnmatchable || currentUnmatchable)
+      errs() << "stDiff: warning: loops without a debug location cannot be "
+                "matched, build both sides with -g\n";
+
+    int matched = 0, added = 0, removed = 0;
+    for (auto const &pair : Base) {
+      auto c = Current.find(pair.first);
+      if (c == Current.end()) {
+        printLoop("Removed", pair.first, *pair.second);
+        removed++;
+        continue;
+      }
+      printLoopDiff(pair.first, *pair.second, *c->second);
+      matched++;
+    }
+    for (auto const &pair : Current) {
+      if (!Base.count(pair.first)) {
+        printLoop("Added", pair.first, *pair.second);
+        added++;
+      }
+    }
+
+    errs() << "==============================================\n";
+    errs() << "Matched Loops: " << matched << "\n";
+    errs() << "Added Loops: " << added << "\n";
+    errs() << "Removed Loops: " << removed << "\n";
+    errs() << "Unmatchable Loops (no debug location): " << baseUnmatchable
+           << " -> " << currentUnmatchable << "\n";
+    errs() << "==============================================\n";
+
+    return false;
+  }
+};
+} // namespace
+char StatsDiff::ID = 0;
+static RegisterPass<StatsDiff>
+    X("stDiff", "Khaled: Compare loop stats against another build");
@@ -0,0 +1,238 @@
+#include "LoopFeatures.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SCCIterator.h"
+#include "llvm/Analysis/CallGraph.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cmath>
+#include <map>
+#include <unordered_map>
+#include <vector>
+using namespace llvm;
+
+static cl::opt<double> LoopWeight(
+    "loop-weight",
+    cl::desc("Assumed iterations per loop level when weighting instructions "
+             "and folded callee summaries by their loop depth"),
+    cl::init(10.0));
+
+namespace {
+
+// Features of one call of a function, including everything it calls. All
+// counts are weighted by LoopWeight^(loop depth) of the instruction (or call
+// site) they come from.
+struct FunctionSummary {
+  std::map<std::string, double> BinOps;
+  double ArrRefs = 0;
+  double Cost = 0;
+  // Call sites, not weighted
+  int Calls = 0;
+  // Loops defined in the function(s) themselves
+  unsigned Loops = 0;
+  // Deepest loop nesting reached, counting loops of callees under the loops
+  // of their call sites
+  unsigned MaxDepth = 0;
+  // Set when the functions of the summary call each other (collapsed SCC)
+  bool Recursive = false;
+  std::vector<Function *> Members;
+};
+
+struct StatsInterproc : public ModulePass {
+  static char ID;
+  StatsInterproc() : ModulePass(ID) {}
+
+  // Defined functions of every call graph SCC, in post-order, and the SCC of
+  // each function
+  std::vector<std::vector<Function *>> sccMembers;
+  std::vector<bool> sccRecursive;
+  DenseMap<const Function *, unsigned> summaryOf;
+
+  // One summary per SCC, valid once its state is Done
+  enum SummaryState { Pending, InProgress, Done };
+  std::vector<SummaryState> states;
+  std::vector<FunctionSummary> summaries;
+
+  // Number of loops seen with each loop ID, as in stCounter
+  std::unordered_map<std::string, unsigned> idCounts;
+
+  void getAnalysisUsage(AnalysisUsage &AU) const {
+    AU.addRequired<CallGraphWrapperPass>();
+    AU.addRequired<LoopInfoWrapperPass>();
+    AU.setPreservesAll();
+  }
+
+  // Add instruction I, found at the given loop depth, to Into. Direct calls
+  // to functions outside the SCC being summarized fold in the callee summary;
+  // calls inside it (recursion) only count as one instruction.
+  void accumulate(Instruction &I, unsigned depth, unsigned selfSCC,
+                  FunctionSummary &Into) {
+    if (isa<DbgInfoIntrinsic>(&I))
+      return;
+
+    double weight = std::pow(LoopWeight, depth);
+    Into.Cost += weight;
+
+    if (isa<BinaryOperator>(&I))
+      Into.BinOps[I.getOpcodeName()] += weight;
+
+    Into.ArrRefs += weight * arrayRefUsers(&I);
+
+    CallBase *CB = dyn_cast<CallBase>(&I);
+    if (!CB || isa<IntrinsicInst>(&I))
+      return;
+    Into.Calls++;
+
+    // Look through bitcasts of the callee (common at -O0 with K&R style
+    // declarations). summarize() already summarized every callee of the SCC,
+    // so this only fails for a cycle the call graph could not see.
+    Function *CalleeF =
+        dyn_cast<Function>(CB->getCalledOperand()->stripPointerCasts());
+    auto found = summaryOf.find(CalleeF);
+    if (found == summaryOf.end() || found->second == selfSCC ||
+        !summarize(found->second))
+      return;
+
+    const FunctionSummary &Callee = summaries[found->second];
+    for (auto const &pair : Callee.BinOps)
+      Into.BinOps[pair.first] += weight * pair.second;
+    Into.ArrRefs += weight * Callee.ArrRefs;
+    Into.Cost += weight * Callee.Cost;
+    Into.MaxDepth = std::max(Into.MaxDepth, depth + Callee.MaxDepth);
+  }
+
+  void printSummary(const FunctionSummary &S) {
+    errs() << "Calls: " << S.Calls << "\n";
+    errs() << "Max Loop Depth (with callees): " << S.MaxDepth << "\n";
+    errs() << "Array References (with callees): " << format("%.1f", S.ArrRefs)
+           << "\n";
+    errs() << "Transitive Cost: " << format("%.1f", S.Cost) << "\n";
+    errs() << "Operation: Weighted Frequency (with callees)\n";
+    for (auto const &pair : S.BinOps)
+      errs() << pair.first << " : " << format("%.1f", pair.second) << "\n";
+  }
+
+  // Summarize SCC id if that was not done yet. Returns false while the SCC is
+  // being summarized, i.e. for a cycle the call graph could not see.
+  bool summarize(unsigned id) {
+    if (states[id] == Done)
+      return true;
+    if (states[id] == InProgress)
+      return false;
+    states[id] = InProgress;
+
+    // Summarize the callees first: getAnalysis for another function releases
+    // the LoopInfo of the previous one, so no callee may be summarized while
+    // a member's LoopInfo is in use below
+    for (Function *F : sccMembers[id]) {
+      for (Instruction &I : instructions(*F)) {
+        CallBase *CB = dyn_cast<CallBase>(&I);
+        if (!CB || isa<IntrinsicInst>(&I))
+          continue;
+        auto found = summaryOf.find(
+            dyn_cast<Function>(CB->getCalledOperand()->stripPointerCasts()));
+        if (found != summaryOf.end() && found->second != id)
+          summarize(found->second);
+      }
+    }
+
+    FunctionSummary S;
+    S.Members = sccMembers[id];
+    S.Recursive = sccRecursive[id];
+    for (Function *F : S.Members) {
+      LoopInfo &LI = getAnalysis<LoopInfoWrapperPass>(*F).getLoopInfo();
+      for (BasicBlock &BB : *F) {
+        unsigned depth = LI.getLoopDepth(&BB);
+        S.MaxDepth = std::max(S.MaxDepth, depth);
+        for (Instruction &I : BB)
+          accumulate(I, depth, id, S);
+      }
+      S.Loops += LI.getLoopsInPreorder().size();
+    }
+    summaries[id] = std::move(S);
+    states[id] = Done;
+    return true;
+  }
+
+  virtual bool runOnModule(Module &M) {
+    CallGraph &CG = getAnalysis<CallGraphWrapperPass>().getCallGraph();
+
+    for (scc_iterator<CallGraph *> I = scc_begin(&CG); !I.isAtEnd(); ++I) {
+      std::vector<Function *> members;
+      for (CallGraphNode *N : *I) {
+        Function *F = N->getFunction();
+        if (F && !F->isDeclaration()) {
+          summaryOf[F] = sccMembers.size();
+          members.push_back(F);
+        }
+      }
+      if (members.empty())
+        continue;
+      sccMembers.push_back(members);
+      sccRecursive.push_back(I.hasCycle());
+    }
+    states.assign(sccMembers.size(), Pending);
+    summaries.resize(sccMembers.size());
+
+    // Callees are summarized before their callers (calls the call graph does
+    // not see summarize their callee on demand), and every function exactly
+    // once, however many call sites it has
+    for (unsigned id = 0; id < sccMembers.size(); ++id)
+      summarize(id);
+
+    for (Function &F : M) {
+      if (F.isDeclaration())
+        continue;
+
+      unsigned selfSCC = summaryOf[&F];
+      const FunctionSummary &S = summaries[selfSCC];
+
+      errs() << "Function " << F.getName() << '\n';
+      errs() << "-----------------\n";
+      errs() << "Loops: " << S.Loops << "\n";
+      if (S.Recursive) {
+        errs() << "Recursive with:";
+        for (Function *Member : S.Members)
+          errs() << " " << Member->getName();
+        errs() << "\n";
+      }
+      printSummary(S);
+      errs() << "=============================\n";
+
+      LoopInfo &LI = getAnalysis<LoopInfoWrapperPass>(F).getLoopInfo();
+      int loopCounter = 0;
+      for (Loop *L : LI) {
+        loopCounter++;
+        errs() << "Analyzing loop " << loopCounter << "\n";
+        errs() << "Loop ID: "
+               << uniqueLoopId(L, std::to_string(loopCounter), idCounts)
+               << "\n";
+
+        FunctionSummary Nest;
+        for (BasicBlock *BB : L->getBlocks()) {
+          unsigned depth = LI.getLoopDepth(BB);
+          Nest.MaxDepth = std::max(Nest.MaxDepth, depth);
+          for (Instruction &I : *BB)
+            accumulate(I, depth, selfSCC, Nest);
+        }
+        printSummary(Nest);
+        errs() << "=============================\n";
+      }
+    }
+
+    return false;
+  }
+};
+} // namespace
+char StatsInterproc::ID = 0;
+static RegisterPass<StatsInterproc>
+    X("stInterproc",
+      "Khaled: Capture loop stats with callee summaries folded in");